@@ -2,8 +2,10 @@
 
 #include <iostream>
 #include <map>
+#include <set>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 
 using namespace std;
 
@@ -12,10 +14,18 @@ Heap::Heap(int32_t heap_size) : heap_size(heap_size), root_set() {
   from = heap;
   to = heap + heap_size / 2;
   bump_ptr = 0;
+  region = nullptr;
+  region_bump = 0;
+  in_region = false;
+  int32_t words = ((heap_size / 2 + 3) / 4 + 63) / 64;
+  from_starts.assign(words, 0);
+  to_starts.assign(words, 0);
+  verify_after_gc = false;
 }
 
 Heap::~Heap() {
   delete[] heap;
+  delete[] region;
 }
 
 // This method should print out the state of the heap.
@@ -26,29 +36,11 @@ void Heap::debug_heap_print(){
   cout << endl;
   cout << "HEAP!!!!!" << endl;
   cout << "from space" << endl;
-  byte *position = from;
-  while(position < from+heap_size/2 && position < from+bump_ptr){
-    int32_t p = local_address(position);
-    object_type type = *reinterpret_cast<object_type*>(position);
-    switch(type) {
-      case FOO: {
-        auto obj = reinterpret_cast<Foo*>(position);
-        cout << p << " = FOO" << endl;
-        position += sizeof(Foo);
-        break;
-      }
-      case BAR: {
-        auto obj = reinterpret_cast<Bar*>(position);
-        cout << p << " = BAR" << endl;
-        position += sizeof(Bar);
-        break;
-      }
-      case BAZ: {
-        auto obj = reinterpret_cast<Baz*>(position);
-        cout << p << " = BAZ" << endl;
-        position += sizeof(Baz);
-        break;
-      }
+  for(obj_ptr p = next_object(0); p != nil_ptr; p = next_object(p + 1)){
+    switch(get_object_type(p)) {
+      case FOO: cout << p << " = FOO" << endl; break;
+      case BAR: cout << p << " = BAR" << endl; break;
+      case BAZ: cout << p << " = BAZ" << endl; break;
     }
   }
   cout << "!!!!!!!!!" << endl;
@@ -130,7 +122,22 @@ void Heap::debug() {
 // IMPORTANT: This method should initiate garbage collection when there is not
 // enough memory. If there is still insufficient memory after garbage collection,
 // this method should throw an out_of_memory exception.
+//
+// Note that every allocation has to go through here, even ones that die
+// right away (e.g. `d = Bar` followed by `d = NULL`). print() lists dead
+// objects that are still in from-space, and the point where collect() runs
+// (and prints) depends on bump_ptr, so eliding or redirecting a
+// non-escaping allocation would change the output. Dead objects are never
+// copied by collect(), so they don't cost anything beyond their bytes.
 obj_ptr Heap::allocate(int32_t size) {
+  if(in_region){
+    // region allocations never trigger a collection
+    if(region_bump + size > heap_size/2) throw OutOfMemoryException();
+    obj_ptr region_pos = heap_size/2 + region_bump;
+    region_bump += size;
+    return region_pos;
+  }
+
   // Implement me
   obj_ptr local_pos = bump_ptr; 
   bump_ptr += size;             
@@ -142,6 +149,7 @@ obj_ptr Heap::allocate(int32_t size) {
   if((from+bump_ptr) >= (from+heap_size/2)){
       throw OutOfMemoryException();
   }
+  mark_start(from_starts, local_pos);
   return local_pos;             // return the initial bump pointer before it was allocated
 }
 
@@ -157,10 +165,14 @@ void Heap::copy_nest(std::map<obj_ptr,obj_ptr> &copy,  byte *position){
       memcpy(new_bump, obj, sizeof(Foo));
       copy[local_address(obj)] = new_bump - to; 
       new_bump += sizeof(Foo);
-      if(obj->c != nil_ptr)
+      if(is_heap_ptr(obj->c))
         copy_nest(copy, from + obj->c);
-      if(obj->d != nil_ptr)
-        copy_nest(copy, from+obj->d);
+      else if(is_region_ptr(obj->c))
+        trace_region(copy, obj->c);
+      if(is_heap_ptr(obj->d))
+        copy_nest(copy, from + obj->d);
+      else if(is_region_ptr(obj->d))
+        trace_region(copy, obj->d);
       break;
     }
     case BAR:{
@@ -168,10 +180,14 @@ void Heap::copy_nest(std::map<obj_ptr,obj_ptr> &copy,  byte *position){
       memcpy(new_bump, obj, sizeof(Bar));
       copy[local_address(obj)] = new_bump - to; 
       new_bump += sizeof(Bar);
-      if(obj->c != nil_ptr)
+      if(is_heap_ptr(obj->c))
         copy_nest(copy, from + obj->c);
-      if(obj->f != nil_ptr)
-        copy_nest(copy, from+obj->f);
+      else if(is_region_ptr(obj->c))
+        trace_region(copy, obj->c);
+      if(is_heap_ptr(obj->f))
+        copy_nest(copy, from + obj->f);
+      else if(is_region_ptr(obj->f))
+        trace_region(copy, obj->f);
       break;
     }
     case BAZ:{
@@ -179,10 +195,48 @@ void Heap::copy_nest(std::map<obj_ptr,obj_ptr> &copy,  byte *position){
       memcpy(new_bump, obj, sizeof(Baz));
       copy[local_address(obj)] = new_bump - to; 
       new_bump += sizeof(Baz);
-      if(obj->c != nil_ptr)
+      if(is_heap_ptr(obj->c))
         copy_nest(copy, from + obj->c);
-      if(obj->b != nil_ptr)
-        copy_nest(copy, from+obj->b);
+      else if(is_region_ptr(obj->c))
+        trace_region(copy, obj->c);
+      if(is_heap_ptr(obj->b))
+        copy_nest(copy, from + obj->b);
+      else if(is_region_ptr(obj->b))
+        trace_region(copy, obj->b);
+      break;
+    }
+  }
+}
+
+// Traces a region object reached during collect(). Region objects are not
+// copied; we only record that they are live and copy what they point to.
+void Heap::trace_region(std::map<obj_ptr,obj_ptr> &copy, obj_ptr ptr){
+  if(region_live.count(ptr)) return;
+  region_live.insert(ptr);
+
+  switch(get_object_type(ptr)){
+    case FOO:{
+      auto obj = global_address<Foo>(ptr);
+      if(is_heap_ptr(obj->c)) copy_nest(copy, from + obj->c);
+      else if(is_region_ptr(obj->c)) trace_region(copy, obj->c);
+      if(is_heap_ptr(obj->d)) copy_nest(copy, from + obj->d);
+      else if(is_region_ptr(obj->d)) trace_region(copy, obj->d);
+      break;
+    }
+    case BAR:{
+      auto obj = global_address<Bar>(ptr);
+      if(is_heap_ptr(obj->c)) copy_nest(copy, from + obj->c);
+      else if(is_region_ptr(obj->c)) trace_region(copy, obj->c);
+      if(is_heap_ptr(obj->f)) copy_nest(copy, from + obj->f);
+      else if(is_region_ptr(obj->f)) trace_region(copy, obj->f);
+      break;
+    }
+    case BAZ:{
+      auto obj = global_address<Baz>(ptr);
+      if(is_heap_ptr(obj->c)) copy_nest(copy, from + obj->c);
+      else if(is_region_ptr(obj->c)) trace_region(copy, obj->c);
+      if(is_heap_ptr(obj->b)) copy_nest(copy, from + obj->b);
+      else if(is_region_ptr(obj->b)) trace_region(copy, obj->b);
       break;
     }
   }
@@ -193,8 +247,15 @@ void Heap::copy_nest(std::map<obj_ptr,obj_ptr> &copy,  byte *position){
 void Heap::collect() {
   // Implement me
   new_bump = to; // global new bump pointer
+  fill(to_starts.begin(), to_starts.end(), 0);
+  region_live.clear();
   map<obj_ptr,obj_ptr> copy;
   for(auto elem : root_set){
+    if(is_region_ptr(elem.second)){
+      // region objects are not moved, but what they point to is
+      trace_region(copy, elem.second);
+      continue;
+    }
     byte *position = from + elem.second;
     object_type type = *reinterpret_cast<object_type*>(position);
     
@@ -206,8 +267,10 @@ void Heap::collect() {
         memcpy(new_bump, obj, sizeof(Foo));
         copy[local_address(obj)] = new_bump - to; 
         new_bump += sizeof(Foo);
-        if(obj->c != nil_ptr) copy_nest(copy, from + obj->c);
-        if(obj->d != nil_ptr) copy_nest(copy, from + obj->d);
+        if(is_heap_ptr(obj->c)) copy_nest(copy, from + obj->c);
+        else if(is_region_ptr(obj->c)) trace_region(copy, obj->c);
+        if(is_heap_ptr(obj->d)) copy_nest(copy, from + obj->d);
+        else if(is_region_ptr(obj->d)) trace_region(copy, obj->d);
         break;
       }
     case BAR: {
@@ -215,8 +278,10 @@ void Heap::collect() {
         memcpy(new_bump, obj, sizeof(Bar));
         copy[local_address(obj)] = new_bump - to;
         new_bump += sizeof(Bar);
-        if(obj->c != nil_ptr) copy_nest(copy, from + obj->c);
-        if(obj->f != nil_ptr) copy_nest(copy, from + obj->f);
+        if(is_heap_ptr(obj->c)) copy_nest(copy, from + obj->c);
+        else if(is_region_ptr(obj->c)) trace_region(copy, obj->c);
+        if(is_heap_ptr(obj->f)) copy_nest(copy, from + obj->f);
+        else if(is_region_ptr(obj->f)) trace_region(copy, obj->f);
         break;
       }
     case BAZ: {
@@ -224,47 +289,97 @@ void Heap::collect() {
         memcpy(new_bump, obj, sizeof(Baz));
         copy[local_address(obj)] = new_bump - to;
         new_bump += sizeof(Baz);
-        if(obj->c != nil_ptr) copy_nest(copy, from + obj->c);
-        if(obj->b != nil_ptr) copy_nest(copy, from + obj->b);
+        if(is_heap_ptr(obj->c)) copy_nest(copy, from + obj->c);
+        else if(is_region_ptr(obj->c)) trace_region(copy, obj->c);
+        if(is_heap_ptr(obj->b)) copy_nest(copy, from + obj->b);
+        else if(is_region_ptr(obj->b)) trace_region(copy, obj->b);
         break;
       }
     }
   }
 
   for(auto fol : copy){
+    mark_start(to_starts, fol.second);
     byte *position = to + fol.second;
     object_type type = *reinterpret_cast<object_type*>(position);
     switch(type) {
       case FOO: {
         auto obj = reinterpret_cast<Foo*>(position);
-        if(obj->c != nil_ptr) obj->c = copy[obj->c];
-        if(obj->d != nil_ptr) obj->d = copy[obj->d];
+        if(is_heap_ptr(obj->c)) obj->c = copy[obj->c];
+        if(is_heap_ptr(obj->d)) obj->d = copy[obj->d];
         break; 
       }
       case BAR: {
         auto obj = reinterpret_cast<Bar*>(position);
-        if(obj->c != nil_ptr) obj->c = copy[obj->c];
-        if(obj->f != nil_ptr) obj->f = copy[obj->f];
+        if(is_heap_ptr(obj->c)) obj->c = copy[obj->c];
+        if(is_heap_ptr(obj->f)) obj->f = copy[obj->f];
         break;
       }
       case BAZ: {
         auto obj = reinterpret_cast<Baz*>(position);
-        if(obj->c != nil_ptr) obj->c = copy[obj->c];
-        if(obj->b != nil_ptr) obj->b = copy[obj->b];
+        if(is_heap_ptr(obj->c)) obj->c = copy[obj->c];
+        if(is_heap_ptr(obj->b)) obj->b = copy[obj->b];
+        break;
+      }
+    }
+  }
+
+  // Live region objects get their pointers updated. Dead ones can never be
+  // reached again, so their pointers into from-space are just dropped.
+  byte *position = region;
+  while(position < region + region_bump){
+    bool live = region_live.count(heap_size/2 + (position - region));
+    object_type type = *reinterpret_cast<object_type*>(position);
+    switch(type) {
+      case FOO: {
+        auto obj = reinterpret_cast<Foo*>(position);
+        if(is_heap_ptr(obj->c)) obj->c = live ? copy[obj->c] : nil_ptr;
+        if(is_heap_ptr(obj->d)) obj->d = live ? copy[obj->d] : nil_ptr;
+        position += sizeof(Foo);
+        break;
+      }
+      case BAR: {
+        auto obj = reinterpret_cast<Bar*>(position);
+        if(is_heap_ptr(obj->c)) obj->c = live ? copy[obj->c] : nil_ptr;
+        if(is_heap_ptr(obj->f)) obj->f = live ? copy[obj->f] : nil_ptr;
+        position += sizeof(Bar);
+        break;
+      }
+      case BAZ: {
+        auto obj = reinterpret_cast<Baz*>(position);
+        if(is_heap_ptr(obj->c)) obj->c = live ? copy[obj->c] : nil_ptr;
+        if(is_heap_ptr(obj->b)) obj->b = live ? copy[obj->b] : nil_ptr;
+        position += sizeof(Baz);
         break;
       }
     }
   }
 
   for(auto elem : root_set){
+    if(is_region_ptr(elem.second)) continue;
     root_set[elem.first] = copy[elem.second];
   }
 
+  // remembered slots follow their owners; slots of dead owners are dropped
+  if(!region_slots.empty()){
+    std::set<std::pair<obj_ptr,int32_t>> slots;
+    for(auto slot : region_slots){
+      if(copy.count(slot.first)) slots.insert(std::make_pair(copy[slot.first], slot.second));
+    }
+    region_slots.swap(slots);
+  }
+
   bump_ptr = new_bump - to; 
   
   byte *temp = from; 
   from = to;
   to = temp; 
+  from_starts.swap(to_starts);
+
+  if(verify_after_gc && !verify()){
+    cerr << "Heap verification failed after collection" << endl;
+    abort();
+  }
   
   // Please do not remove the call to print, it has to be the final
   // operation in the method for your assignment to be graded.
@@ -272,6 +387,318 @@ void Heap::collect() {
 }
 
 
+void Heap::region_begin() {
+  if(in_region) throw std::runtime_error("Region already active");
+  // most programs never use a region, so the arena is only allocated here
+  if(!region) region = new byte[heap_size / 2];
+  in_region = true;
+}
+
+// Finds every region object reachable from a remembered from-space slot or
+// from a variable, and returns their total size.
+int32_t Heap::region_reachable(std::set<obj_ptr> &promote) {
+  vector<obj_ptr> pending;
+  for(auto slot : region_slots){
+    pending.push_back(*reinterpret_cast<obj_ptr*>(from + slot.first + slot.second));
+  }
+  for(auto elem : root_set){
+    pending.push_back(elem.second);
+  }
+
+  int32_t size = 0;
+  while(!pending.empty()){
+    obj_ptr ptr = pending.back();
+    pending.pop_back();
+    if(!is_region_ptr(ptr) || promote.count(ptr)) continue;
+    promote.insert(ptr);
+    switch(get_object_type(ptr)) {
+      case FOO: {
+        auto obj = global_address<Foo>(ptr);
+        pending.push_back(obj->c);
+        pending.push_back(obj->d);
+        size += sizeof(Foo);
+        break;
+      }
+      case BAR: {
+        auto obj = global_address<Bar>(ptr);
+        pending.push_back(obj->c);
+        pending.push_back(obj->f);
+        size += sizeof(Bar);
+        break;
+      }
+      case BAZ: {
+        auto obj = global_address<Baz>(ptr);
+        pending.push_back(obj->c);
+        pending.push_back(obj->b);
+        size += sizeof(Baz);
+        break;
+      }
+    }
+  }
+  return size;
+}
+
+// Ends the current region. Region objects that are reachable from from-space
+// or from a variable are copied into from-space, and the rest of the region
+// is dropped at once. If they don't fit even after a collection, the region
+// is still ended: pointers into it become NULL, variables bound to it are
+// unbound, and OutOfMemoryException is thrown afterwards.
+void Heap::region_end() {
+  if(!in_region) throw std::runtime_error("No active region");
+
+  // make room for all of them up front, so nothing moves while we copy
+  std::set<obj_ptr> promote;
+  int32_t size = region_reachable(promote);
+  if(size > 0 && bump_ptr + size >= heap_size/2){
+    collect();
+    promote.clear();
+    size = region_reachable(promote);
+  }
+  bool fits = size == 0 || bump_ptr + size < heap_size/2;
+
+  // copy in allocation order, so promoted objects keep their relative layout
+  map<obj_ptr,obj_ptr> forward;
+  if(fits){
+    for(auto ptr : promote){
+      byte *position = address(ptr);
+      forward[ptr] = bump_ptr;
+      mark_start(from_starts, bump_ptr);
+      switch(get_object_type(ptr)) {
+        case FOO: {
+          memcpy(from + bump_ptr, position, sizeof(Foo));
+          bump_ptr += sizeof(Foo);
+          break;
+        }
+        case BAR: {
+          memcpy(from + bump_ptr, position, sizeof(Bar));
+          bump_ptr += sizeof(Bar);
+          break;
+        }
+        case BAZ: {
+          memcpy(from + bump_ptr, position, sizeof(Baz));
+          bump_ptr += sizeof(Baz);
+          break;
+        }
+      }
+    }
+
+    // promoted objects still point at each other's region addresses
+    for(auto fwd : forward){
+      switch(get_object_type(fwd.second)) {
+        case FOO: {
+          auto obj = global_address<Foo>(fwd.second);
+          if(is_region_ptr(obj->c)) obj->c = forward[obj->c];
+          if(is_region_ptr(obj->d)) obj->d = forward[obj->d];
+          break;
+        }
+        case BAR: {
+          auto obj = global_address<Bar>(fwd.second);
+          if(is_region_ptr(obj->c)) obj->c = forward[obj->c];
+          if(is_region_ptr(obj->f)) obj->f = forward[obj->f];
+          break;
+        }
+        case BAZ: {
+          auto obj = global_address<Baz>(fwd.second);
+          if(is_region_ptr(obj->c)) obj->c = forward[obj->c];
+          if(is_region_ptr(obj->b)) obj->b = forward[obj->b];
+          break;
+        }
+      }
+    }
+  }
+
+  // the remembered slots are the only other from-space pointers into the region
+  for(auto slot : region_slots){
+    obj_ptr *fld = reinterpret_cast<obj_ptr*>(from + slot.first + slot.second);
+    if(is_region_ptr(*fld)) *fld = forward.count(*fld) ? forward[*fld] : nil_ptr;
+  }
+
+  // variables follow their promoted objects; only when out of memory are
+  // they left without one, and then they are unbound
+  for(auto it = root_set.begin(); it != root_set.end(); ){
+    if(!is_region_ptr(it->second)) ++it;
+    else if(forward.count(it->second)) { it->second = forward[it->second]; ++it; }
+    else {
+      cerr << "REGION END: unbinding " << it->first << endl;
+      it = root_set.erase(it);
+    }
+  }
+
+  region_slots.clear();
+  region_bump = 0;
+  in_region = false;
+  if(!fits) throw OutOfMemoryException();
+}
+
+void Heap::mark_start(std::vector<uint64_t> &starts, int32_t offset) {
+  int32_t granule = offset / 4;
+  starts[granule / 64] |= uint64_t(1) << (granule % 64);
+}
+
+bool Heap::is_object_start(obj_ptr ptr) {
+  if(ptr < 0 || ptr >= bump_ptr || ptr % 4 != 0) return false;
+  int32_t granule = ptr / 4;
+  return (from_starts[granule / 64] >> (granule % 64)) & 1;
+}
+
+// Skips whole 64 bit words of the bitmap at a time, so walking the heap
+// never has to decode the objects in between.
+obj_ptr Heap::next_object(int32_t offset) {
+  int32_t granule = (offset + 3) / 4;
+  int32_t word = granule / 64;
+  if(word >= (int32_t)from_starts.size()) return nil_ptr;
+  uint64_t bits = from_starts[word] & (~uint64_t(0) << (granule % 64));
+  while(bits == 0){
+    if(++word >= (int32_t)from_starts.size()) return nil_ptr;
+    bits = from_starts[word];
+  }
+  obj_ptr ptr = (word * 64 + __builtin_ctzll(bits)) * 4;
+  return ptr < bump_ptr ? ptr : nil_ptr;
+}
+
+bool Heap::verify() {
+  // Gather every pointer first: roots, then two fields per from-space object,
+  // then two fields per region object. Owners are only looked up again if
+  // something turns out to be wrong.
+  vector<obj_ptr> ptrs;
+  for(auto elem : root_set){
+    ptrs.push_back(elem.second);
+  }
+
+  bool ok = true;
+  obj_ptr end = 0;
+  for(obj_ptr p = next_object(0); p != nil_ptr; p = next_object(p + 1)){
+    if(end == 0 && p != 0){
+      cerr << "VERIFY: first object in from-space is at " << p << ", not at 0" << endl;
+      ok = false;
+    }
+    else if(p != end){
+      cerr << "VERIFY: object at " << p << " does not start where the previous one ends (" << end << ")" << endl;
+      ok = false;
+    }
+    switch(get_object_type(p)) {
+      case FOO: {
+        auto obj = global_address<Foo>(p);
+        ptrs.push_back(obj->c);
+        ptrs.push_back(obj->d);
+        end = p + sizeof(Foo);
+        break;
+      }
+      case BAR: {
+        auto obj = global_address<Bar>(p);
+        ptrs.push_back(obj->c);
+        ptrs.push_back(obj->f);
+        end = p + sizeof(Bar);
+        break;
+      }
+      case BAZ: {
+        auto obj = global_address<Baz>(p);
+        ptrs.push_back(obj->b);
+        ptrs.push_back(obj->c);
+        end = p + sizeof(Baz);
+        break;
+      }
+      default: {
+        cerr << "VERIFY: bad type tag at " << p << endl;
+        return false;
+      }
+    }
+  }
+  // A failed allocation leaves bump_ptr past the end of from-space, with no
+  // object behind it, so only a bump_ptr inside from-space has to match.
+  if(end != bump_ptr && bump_ptr < heap_size / 2){
+    cerr << "VERIFY: last object in from-space ends at " << end << ", but bump_ptr is " << bump_ptr << endl;
+    ok = false;
+  }
+
+  // The region has no bitmap of its own, so build one while walking it.
+  // It always has at least one word, so the lookup below never needs a branch.
+  vector<uint64_t> region_starts(((region_bump + 3) / 4 + 63) / 64 + 1, 0);
+  byte *position = region;
+  while(position < region + region_bump){
+    obj_ptr p = heap_size / 2 + (position - region);
+    mark_start(region_starts, position - region);
+    switch(get_object_type(p)) {
+      case FOO: {
+        auto obj = reinterpret_cast<Foo*>(position);
+        ptrs.push_back(obj->c);
+        ptrs.push_back(obj->d);
+        position += sizeof(Foo);
+        break;
+      }
+      case BAR: {
+        auto obj = reinterpret_cast<Bar*>(position);
+        ptrs.push_back(obj->c);
+        ptrs.push_back(obj->f);
+        position += sizeof(Bar);
+        break;
+      }
+      case BAZ: {
+        auto obj = reinterpret_cast<Baz*>(position);
+        ptrs.push_back(obj->b);
+        ptrs.push_back(obj->c);
+        position += sizeof(Baz);
+        break;
+      }
+      default: {
+        cerr << "VERIFY: bad type tag at " << p << endl;
+        return false;
+      }
+    }
+  }
+
+  // A pointer is fine if it is nil, or lands on a set bit of the from-space
+  // or region bitmap. This is one branch free pass: out of range offsets are
+  // clamped to granule 0 and masked off, and both bitmaps are always read.
+  const uint64_t *fbits = from_starts.data();
+  const uint64_t *rbits = region_starts.data();
+  int32_t half = heap_size / 2;
+  vector<uint8_t> valid(ptrs.size());
+  for(size_t i = 0; i < ptrs.size(); ++i){
+    obj_ptr p = ptrs[i];
+    int32_t in_region = p >= half;
+    int32_t offset = p - in_region * half;
+    int32_t limit = in_region ? region_bump : bump_ptr;
+    int32_t in_range = (offset >= 0) & (offset < limit) & ((offset & 3) == 0);
+    int32_t granule = (offset & -in_range) >> 2;
+    uint64_t from_word = fbits[(granule & -(1 - in_region)) >> 6];
+    uint64_t region_word = rbits[(granule & -in_region) >> 6];
+    uint64_t word = in_region ? region_word : from_word;
+    valid[i] = (p == nil_ptr) | (in_range & (int32_t)((word >> (granule & 63)) & 1));
+  }
+
+  size_t bad = 0;
+  for(size_t i = 0; i < ptrs.size(); ++i){
+    bad += !valid[i];
+  }
+  if(bad == 0) return ok;
+
+  // Walk everything again in the same order to report who holds bad pointers.
+  size_t i = 0;
+  for(auto elem : root_set){
+    if(!valid[i++]) cerr << "VERIFY: variable " << elem.first << " points to " << elem.second << ", which is not an object" << endl;
+  }
+  for(obj_ptr p = next_object(0); p != nil_ptr; p = next_object(p + 1), i += 2){
+    for(size_t j = i; j < i + 2; ++j){
+      if(!valid[j]) cerr << "VERIFY: object at " << p << " points to " << ptrs[j] << ", which is not an object" << endl;
+    }
+  }
+  position = region;
+  while(position < region + region_bump){
+    obj_ptr p = heap_size / 2 + (position - region);
+    for(size_t j = i; j < i + 2; ++j){
+      if(!valid[j]) cerr << "VERIFY: object at " << p << " points to " << ptrs[j] << ", which is not an object" << endl;
+    }
+    i += 2;
+    switch(get_object_type(p)) {
+      case FOO: position += sizeof(Foo); break;
+      case BAR: position += sizeof(Bar); break;
+      case BAZ: position += sizeof(Baz); break;
+    }
+  }
+  return false;
+}
+
 obj_ptr Heap::get_root(const std::string& name) {
   auto root = root_set.find(name);
   if(root == root_set.end()) {
@@ -281,7 +708,7 @@ obj_ptr Heap::get_root(const std::string& name) {
 }
 
 object_type Heap::get_object_type(obj_ptr ptr) {
-  return *reinterpret_cast<object_type*>(from + ptr);
+  return *reinterpret_cast<object_type*>(address(ptr));
 }
 
 // Finds fields by path / name; used by get() and set().
@@ -336,25 +763,33 @@ void Heap::set(const std::vector<std::string>& path, obj_ptr value) {
     else root_set[path[0]] = value;
   }
   else {
-    *get_nested(path) = value;
+    obj_ptr *fld = get_nested(path);
+    *fld = value;
+    // A from-space field that now points into the region is remembered, so
+    // region_end() only has to look at these slots.
+    byte *slot = reinterpret_cast<byte*>(fld);
+    if(is_region_ptr(value) && slot >= from && slot < from + heap_size / 2) {
+      obj_ptr owner = get(std::vector<std::string>(path.begin(), path.end() - 1));
+      region_slots.insert(std::make_pair(owner, local_address(slot) - owner));
+    }
   }
 }
 
 obj_ptr Heap::new_foo() {
   auto heap_addr = allocate(sizeof(Foo));
-  new (from + heap_addr) Foo(object_id++);
+  new (address(heap_addr)) Foo(object_id++);
   return heap_addr;
 }
 
 obj_ptr Heap::new_bar() {
   auto heap_addr = allocate(sizeof(Bar));
-  new (from + heap_addr) Bar(object_id++);
+  new (address(heap_addr)) Bar(object_id++);
   return heap_addr;
 }
 
 obj_ptr Heap::new_baz() {
   auto heap_addr = allocate(sizeof(Baz));
-  new (from + heap_addr) Baz(object_id++);
+  new (address(heap_addr)) Baz(object_id++);
   return heap_addr;
 }
 
@@ -2,6 +2,8 @@
 #include <stdexcept>
 #include <string>
 #include <map>
+#include <set>
+#include <utility>
 #include <vector>
 
 typedef int8_t byte;
@@ -74,6 +76,11 @@ struct Baz {
   Baz(uint32_t id) : id(id) {}
 };
 
+// The object-start bitmaps in Heap keep one bit per 4 bytes, which only
+// works as long as every object is a multiple of 4 bytes in size.
+static_assert(sizeof(Foo) % 4 == 0 && sizeof(Bar) % 4 == 0 && sizeof(Baz) % 4 == 0,
+              "object sizes must be a multiple of 4 for the object-start bitmaps");
+
 
 // This exception should be thrown when an allocation is attempted, but
 // garbage collection is unable to free the needed space.
@@ -108,6 +115,34 @@ class Heap {
 
   byte *new_bump; //global new bump pointer
 
+  // region is a separate bump arena used between REGION BEGIN and REGION END,
+  // allocated the first time a region begins.
+  // Objects in it are never copied by collect(), and the whole arena is freed
+  // at once when the region ends. Region addresses start at heap_size / 2, so
+  // they can never be confused with from-space addresses.
+  byte *region;
+  // region_bump is the bump pointer in the region, relative to the region pointer.
+  int32_t region_bump;
+  // in_region is true while allocations go into the region.
+  bool in_region;
+  // region_live holds the region objects found reachable during collect().
+  std::set<obj_ptr> region_live;
+  // region_slots remembers every from-space field that was set to point into
+  // the region, as (owner, offset of the field in the owner). collect() moves
+  // them along with their owners, and region_end() only checks these.
+  std::set<std::pair<obj_ptr,int32_t>> region_slots;
+
+  // Object-start bitmaps for the from and to spaces. Every object is a multiple
+  // of 4 bytes in size, so there is one bit per 4 byte granule, and a bit is set
+  // iff an object starts there. They are swapped together with from and to.
+  // This lets us find objects without decoding every type tag on the way,
+  // and check that a pointer really points at an object.
+  std::vector<uint64_t> from_starts;
+  std::vector<uint64_t> to_starts;
+  // If set, the heap is verified after every collection, and we abort if
+  // anything is wrong. Toggled with VERIFY ON / VERIFY OFF.
+  bool verify_after_gc;
+
   // This is your root set, it maps variables to object pointers (again, object pointers
   // are relative to the from pointer). If you were to allocate objects of sizes 5 and 10
   // on an empty heap, and assign them to x and y, your root set would look like this:
@@ -127,8 +162,30 @@ public:
 
   // You should define collect in impl.cpp
   void    copy_nest(std::map<obj_ptr,obj_ptr> &copy, byte *position);
+  void    trace_region(std::map<obj_ptr,obj_ptr> &copy, obj_ptr ptr);
   void    collect();
 
+  // region_begin() starts allocating into the region arena, region_end()
+  // promotes region objects that from-space or a variable points to, and
+  // frees the rest.
+  void    region_begin();
+  void    region_end();
+  int32_t region_reachable(std::set<obj_ptr> &promote);
+
+  // Marks an object start at the given offset in an object-start bitmap.
+  void    mark_start(std::vector<uint64_t> &starts, int32_t offset);
+  // Returns the first object start in from-space at or after offset,
+  // or nil_ptr if there is none below bump_ptr.
+  obj_ptr next_object(int32_t offset);
+  bool    is_object_start(obj_ptr ptr);
+
+  // verify() checks that every root and every pointer field in from-space and
+  // the region is nil or points to an object start in from-space or the region,
+  // and that from-space objects are laid out back to back from 0 to bump_ptr.
+  // Problems are written to stderr; returns true if there were none.
+  bool    verify();
+  void    set_verify_after_gc(bool on) { verify_after_gc = on; }
+
   // You should optionally define debug in impl.cpp
   void debug_heap_print();
   void debug_tracker(std::string var, byte *postion);
@@ -169,6 +226,23 @@ public:
   // in the from space, will return its type (ie. FOO, BAR or BAZ).
   object_type get_object_type(obj_ptr);
 
+  // Returns true if the pointer refers to an object in the region arena
+  // rather than in the from space.
+  bool is_region_ptr(obj_ptr ptr) {
+    return ptr >= heap_size / 2;
+  }
+
+  // Returns true if the pointer refers to an object in the from space.
+  bool is_heap_ptr(obj_ptr ptr) {
+    return ptr != nil_ptr && !is_region_ptr(ptr);
+  }
+
+  // Converts a local address (from-space or region) to an actual byte pointer.
+  byte* address(obj_ptr ptr) {
+    if(is_region_ptr(ptr)) return region + (ptr - heap_size / 2);
+    return from + ptr;
+  }
+
   // Converts a global pointer (to an actual struct) to a heap-local pointer.
   // For example, if you have an object Foo at the beginning of the heap,
   // and would like its local address (which in this case would be 0), you can do:
@@ -186,6 +260,6 @@ public:
   // actual structure.
   template<class T>
   T* global_address(int32_t addr) {
-    return reinterpret_cast<T*>(from + addr);
+    return reinterpret_cast<T*>(address(addr));
   }
 };
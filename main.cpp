@@ -79,6 +79,27 @@ int main(int argc, char *argv[]) {
       heap.collect();
       continue;
     }
+    if(line == "VERIFY") {
+      std::cout << (heap.verify() ? "VERIFY OK\n" : "VERIFY FAILED\n");
+      continue;
+    }
+    if(line == "VERIFYON" || line == "VERIFYOFF") {
+      heap.set_verify_after_gc(line == "VERIFYON");
+      continue;
+    }
+    if(line == "REGIONBEGIN" || line == "REGIONEND") {
+      try {
+        if(line == "REGIONBEGIN") heap.region_begin();
+        else heap.region_end();
+      }
+      catch(const OutOfMemoryException& e) {
+        std::cout << "OUT OF MEMORY\n";
+      }
+      catch(const std::runtime_error& e) {
+        std::cerr << e.what() << '\n';
+      }
+      continue;
+    }
 
     int pos = line.find('=');
     if(pos == std::string::npos) {